@@ -0,0 +1,203 @@
+#pragma once
+
+#include "Header.h"
+#include "EyeDetection.h"
+#include "Threads.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace facelapse {
+
+    /*
+     * Runs findEyeCoords for the eye editor on background threads.
+     *
+     * Explicit requests go first, then the frames closest to the cursor, so the sweep over the whole
+     * set starts where the user is. A manual edit cancels the detection of that frame, a result that
+     * arrives afterwards is dropped.
+     */
+    class DetectionQueue {
+    public:
+        // Only frames flagged in sweep are detected without being requested
+        DetectionQueue(const std::vector<std::string>& frameSet, const std::vector<int>& frameOrientations, const std::vector<bool>& sweep)
+            : frames(frameSet), orientations(frameOrientations), entries(frameSet.size()),
+              cursor(0), outstanding(0), anyDetected(false), stopping(false)
+        {
+            for (size_t i = 0; i < entries.size(); i++) {
+                if (sweep[i]) {
+                    entries[i].state = Pending;
+                    outstanding++;
+                }
+            }
+        }
+
+        ~DetectionQueue() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            cond.notify_all();
+            for (auto& t : workers) {
+                t.join();
+            }
+        }
+
+        // Starts the sweep, if there is anything to sweep. Without it, a worker is started by the first request.
+        void start() {
+            if (idle()) {
+                return;
+            }
+            unsigned int n = backgroundThreadCount();
+            spawn(n < maxWorkers ? n : maxWorkers);
+        }
+
+        void setCursor(int index) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cursor = index;
+        }
+
+        // Detect (again) before anything else
+        void request(int index) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Entry& e = entries[index];
+                if (e.state != Pending && e.state != Running) {
+                    outstanding++;
+                }
+                e.state = Pending;
+                e.fresh = false;
+                urgent.push_front(index);
+            }
+            spawn(1);
+            cond.notify_one();
+        }
+
+        // The frame was edited by hand, which takes priority over any detection
+        void cancel(int index) {
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry& e = entries[index];
+            if (e.state == Pending || e.state == Running) {
+                outstanding--;
+            }
+            e.state = Manual;
+            e.fresh = false;
+        }
+
+        // Result of a finished detection
+        bool result(int index, CoordinatePair& cp) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (entries[index].state != Done) {
+                return false;
+            }
+            cp = entries[index].found;
+            return true;
+        }
+
+        // Like result, but only once per detection
+        bool fetchNew(int index, CoordinatePair& cp) {
+            std::lock_guard<std::mutex> lock(mutex);
+            Entry& e = entries[index];
+            if (e.state != Done || !e.fresh) {
+                return false;
+            }
+            e.fresh = false;
+            cp = e.found;
+            return true;
+        }
+
+        // Whether any frame was detected, even if the result was dropped
+        bool detectedAny() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return anyDetected;
+        }
+
+        // Nothing to wait for, also no result of the cursor frame that wasn't fetched yet
+        bool idle() {
+            std::lock_guard<std::mutex> lock(mutex);
+            bool cursorFresh = cursor < (int)entries.size() && entries[cursor].state == Done && entries[cursor].fresh;
+            return outstanding == 0 && !cursorFresh;
+        }
+
+    private:
+        static const unsigned int maxWorkers = 4; // each one holds its own classifiers
+
+        enum State { Idle, Pending, Running, Done, Manual };
+        struct Entry {
+            State state = Idle;
+            bool fresh = false;
+            CoordinatePair found;
+        };
+
+        std::vector<std::string> frames;
+        std::vector<int> orientations;
+        std::vector<Entry> entries;
+        std::deque<int> urgent;
+        int cursor;
+        int outstanding; // pending or running
+        bool anyDetected;
+        bool stopping;
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        // Only called from the thread that owns the queue
+        void spawn(unsigned int n) {
+            while (workers.size() < n) {
+                workers.push_back(std::thread(&DetectionQueue::work, this));
+            }
+        }
+
+        // Requested frames first, then the pending frame closest to the cursor
+        int pick() {
+            while (!urgent.empty()) {
+                int index = urgent.front();
+                urgent.pop_front();
+                if (entries[index].state == Pending) {
+                    return index;
+                }
+            }
+            int n = entries.size();
+            for (int d = 0; d < n; d++) {
+                if (cursor + d < n && entries[cursor + d].state == Pending) {
+                    return cursor + d;
+                }
+                if (cursor - d >= 0 && entries[cursor - d].state == Pending) {
+                    return cursor - d;
+                }
+            }
+            return -1;
+        }
+
+        void work() {
+            initDetector();
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                int index = pick();
+                if (index == -1) {
+                    cond.wait(lock);
+                    continue;
+                }
+                entries[index].state = Running;
+
+                lock.unlock();
+                CoordinatePair cp = findEyeCoords(frames[index], orientations[index]);
+                lock.lock();
+                anyDetected = true;
+
+                Entry& e = entries[index];
+                if (e.state == Running) { // not canceled or requested again meanwhile
+                    e.state = Done;
+                    e.fresh = true;
+                    e.found = cp;
+                    outstanding--;
+                }
+            }
+        }
+    };
+}
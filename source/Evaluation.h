@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Header.h"
+#include "EyeDetection.h"
+#include "Threads.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace facelapse {
+
+    // Value at fraction p of sorted values
+    float percentile(const std::vector<float>& sorted, float p) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        size_t i = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5f));
+        return sorted[i];
+    }
+
+    /*
+     * Runs findEyeCoords over the frames in parallel and compares the results with the saved coordinates.
+     * Reports the latency per frame, the rate of complete detections and the pixel error, which is
+     * normalised by the saved distance between the eyes so frames of different resolutions compare.
+     */
+    void evaluateDetector(const std::vector<std::string>& frameSet, const std::vector<CoordinatePair>& truth,
+                          const std::vector<int>& orientations, const DetectionParams& params) {
+        std::vector<float> latencies(frameSet.size());
+        std::vector<CoordinatePair> found(frameSet.size());
+
+        auto start = std::chrono::steady_clock::now();
+        unsigned int n = parallelFor(frameSet.size(), [&](size_t i) {
+            if (!detectorBackend) { // once per thread, before the clock starts
+                initDetector();
+            }
+            auto begin = std::chrono::steady_clock::now();
+            found[i] = findEyeCoords(frameSet[i], orientations[i], params);
+            latencies[i] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        });
+        float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<float> errors;
+        for (size_t i = 0; i < frameSet.size(); i++) {
+            if (!found[i].isComplete()) {
+                continue;
+            }
+            CoordinatePair gt = truth[i];
+            float errR = std::hypot(found[i].rX - gt.rX, found[i].rY - gt.rY);
+            float errL = std::hypot(found[i].lX - gt.lX, found[i].lY - gt.lY);
+            errors.push_back((errR + errL) / 2 / gt.dist());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::sort(errors.begin(), errors.end());
+
+        float mean = 0;
+        size_t within5 = 0, within10 = 0;
+        for (float e : errors) {
+            mean += e / errors.size();
+            within5 += e <= 0.05f;
+            within10 += e <= 0.1f;
+        }
+        float total = std::max<size_t>(1, frameSet.size());
+        float detected = std::max<size_t>(1, errors.size());
+
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "Detector " << params << std::endl;
+        std::cout << "  frames: " << frameSet.size() << ", detected: " << errors.size() << " (" << 100 * errors.size() / total << "%)"
+            << ", " << frameSet.size() / std::max(seconds, 0.001f) << " frames/s on " << n << " threads" << std::endl;
+        std::cout << "  latency ms: p50 " << percentile(latencies, 0.5f) << ", p90 " << percentile(latencies, 0.9f)
+            << ", p99 " << percentile(latencies, 0.99f) << ", max " << percentile(latencies, 1) << std::endl;
+        std::cout << std::setprecision(3);
+        std::cout << "  error / eye distance: mean " << mean << ", p50 " << percentile(errors, 0.5f) << ", p90 " << percentile(errors, 0.9f)
+            << std::setprecision(1) << ", within 5%: " << 100 * within5 / detected << "%, within 10%: " << 100 * within10 / detected << "%" << std::endl;
+        std::cout << std::defaultfloat << std::setprecision(6);
+    }
+}
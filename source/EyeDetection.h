@@ -1,36 +1,216 @@
+#pragma once
+
 #include "opencv2/objdetect.hpp"
 #include "opencv2/highgui.hpp"
 #include "opencv2/imgproc.hpp"
 
 #include "Cascades.h"
 #include "Header.h"
+#include "ImageInfo.h"
+#include "Preprocessing.h"
 
 #include <iostream>
+#include <memory>
+#include <sstream>
 
 namespace facelapse {
-	cv::CascadeClassifier face_cascade;
-	cv::CascadeClassifier eyes_cascade;
+	// Per thread buffers, so detecting doesn't allocate per frame
+	struct DetectionScratch {
+		ScratchBuffer frame, eye;
+		std::vector<cv::Rect> faces, eyes;
+		std::vector<cv::Vec3f> circles;
+	};
+	thread_local DetectionScratch scratch;
+
+	// Tuning parameters of findEyeCoords
+	struct DetectionParams {
+		float workingHeight = 400; // height the frame is scaled to for the face search
+		double faceScaleFactor = 1.1;
+		int faceNeighbors = 10;
+		double eyeScaleFactor = 1.3;
+		float eyeZoom = 0.75; // part of the detected eye rectangle searched for the pupil
+		float eyeHeight = 70; // height the eye is scaled to for the pupil search
+		int threshold = 40;
+	};
+
+	std::ostream &operator<<(std::ostream &os, DetectionParams const &p) {
+		return os << "height=" << p.workingHeight << ",scale=" << p.faceScaleFactor << ",neighbors=" << p.faceNeighbors
+			<< ",eyescale=" << p.eyeScaleFactor << ",zoom=" << p.eyeZoom << ",eyeheight=" << p.eyeHeight << ",threshold=" << p.threshold;
+	}
+
+	// Parses a comma separated list like "height=400,scale=1.1,zoom=0.75", missing keys keep their defaults
+	bool parseDetectionParams(std::string str, DetectionParams& params) {
+		params = DetectionParams();
+		if (str == "default") {
+			return true;
+		}
+		std::stringstream ss(str);
+		std::string item;
+		while (std::getline(ss, item, ',')) {
+			size_t eq = item.find('=');
+			if (eq == std::string::npos) {
+				return false;
+			}
+			std::string key = item.substr(0, eq);
+			std::string value = item.substr(eq + 1);
+			try {
+				if (key == "height") params.workingHeight = std::stof(value);
+				else if (key == "scale") params.faceScaleFactor = std::stod(value);
+				else if (key == "neighbors") params.faceNeighbors = std::stoi(value);
+				else if (key == "eyescale") params.eyeScaleFactor = std::stod(value);
+				else if (key == "zoom") params.eyeZoom = std::stof(value);
+				else if (key == "eyeheight") params.eyeHeight = std::stof(value);
+				else if (key == "threshold") params.threshold = std::stoi(value);
+				else return false;
+			} catch (const std::exception&) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+	 * Finds the face and the eye regions for findEyeCoords, the pupils are then located in the full frame.
+	 * Backends keep their classifiers, which aren't thread safe, so every thread creates its own (see initDetector).
+	 */
+	class DetectorBackend {
+	public:
+		virtual ~DetectorBackend() {}
+		// Faces in the equalized gray working image
+		virtual void findFaces(const cv::Mat& gray, std::vector<cv::Rect>& faces, const DetectionParams& params) = 0;
+		// Two eye rectangles relative to the face, false if they can't be found
+		virtual bool findEyes(const cv::Mat& faceGray, std::vector<cv::Rect>& eyes, const DetectionParams& params) = 0;
+	};
+
+	// Haar cascades embedded in Cascades.h, the default
+	class HaarBackend : public DetectorBackend {
+	public:
+		HaarBackend() {
+			cv::FileStorage fsEye(EYE_CASCADE_STR, cv::FileStorage::MEMORY);
+			eyes_cascade.read(fsEye.getFirstTopLevelNode());
 
-	CoordinatePair findEyeCoords(std::string path) {
-		// Load image
-		cv::Mat fullFrame = cv::imread(path, CV_LOAD_IMAGE_COLOR);
+			cv::FileStorage fsFace(FACE_CASCADE_STR, cv::FileStorage::MEMORY);
+			face_cascade.read(fsFace.getFirstTopLevelNode());
+		}
+
+		void findFaces(const cv::Mat& gray, std::vector<cv::Rect>& faces, const DetectionParams& params) override {
+			face_cascade.detectMultiScale(gray, faces, params.faceScaleFactor, params.faceNeighbors);
+		}
+
+		bool findEyes(const cv::Mat& faceGray, std::vector<cv::Rect>& eyes, const DetectionParams& params) override {
+			// Find 2 eyes, using a Haar Cascade with a binary search for the paramenter
+			eyes.clear();
+			int minE=2, maxE=100;
+			while (eyes.size() != 2) {
+				int avg = (minE + maxE) / 2;
+				if (avg == maxE || avg == minE) break;
+				eyes_cascade.detectMultiScale(faceGray, eyes, params.eyeScaleFactor, avg);
+				//std::cout << "  Eyes parma=" << avg << " -> " << eyes.size() << std::endl; // DEBUG
+				if (eyes.size() > 2) {
+					minE = avg;
+				} else if (eyes.size() < 2) {
+					maxE = avg;
+				}
+			}
+			return eyes.size() == 2;
+		}
+
+	private:
+		cv::CascadeClassifier face_cascade;
+		cv::CascadeClassifier eyes_cascade;
+	};
+
+	/*
+	 * LBP face cascade as shipped with OpenCV, which only uses integer features and is several times faster
+	 * than Haar. OpenCV has no LBP eye cascade, the eye regions are placed by the usual face proportions
+	 * and the pupil search in findEyeCoords does the rest.
+	 */
+	class LbpBackend : public DetectorBackend {
+	public:
+		bool load() {
+			const char* candidates[] = {
+				"lbpcascade_frontalface_improved.xml",
+				"/usr/share/opencv4/lbpcascades/lbpcascade_frontalface_improved.xml",
+				"/usr/local/share/opencv4/lbpcascades/lbpcascade_frontalface_improved.xml",
+				"/usr/share/opencv/lbpcascades/lbpcascade_frontalface_improved.xml",
+				"/usr/local/share/OpenCV/lbpcascades/lbpcascade_frontalface_improved.xml",
+				"/usr/share/OpenCV/lbpcascades/lbpcascade_frontalface_improved.xml",
+			};
+			for (auto path : candidates) {
+				if (face_cascade.load(path)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void findFaces(const cv::Mat& gray, std::vector<cv::Rect>& faces, const DetectionParams& params) override {
+			face_cascade.detectMultiScale(gray, faces, params.faceScaleFactor, params.faceNeighbors);
+		}
+
+		bool findEyes(const cv::Mat& faceGray, std::vector<cv::Rect>& eyes, const DetectionParams& /*params*/) override {
+			const float eyeY = 0.38f, eyeX = 0.3f, size = 0.25f; // relative to the face
+			int w = faceGray.cols * size, h = faceGray.cols * size;
+			int y = faceGray.rows * eyeY - h / 2;
+			eyes.clear();
+			eyes.push_back(cv::Rect(faceGray.cols * eyeX - w / 2, y, w, h));
+			eyes.push_back(cv::Rect(faceGray.cols * (1 - eyeX) - w / 2, y, w, h));
+			return true;
+		}
+
+	private:
+		cv::CascadeClassifier face_cascade;
+	};
+
+	// Backend used by initDetector
+	std::string detectorBackendName = "haar";
+	thread_local std::unique_ptr<DetectorBackend> detectorBackend;
+
+	std::unique_ptr<DetectorBackend> createBackend(std::string name) {
+		if (name == "haar") {
+			return std::unique_ptr<DetectorBackend>(new HaarBackend());
+		}
+		if (name == "lbp") {
+			std::unique_ptr<LbpBackend> lbp(new LbpBackend());
+			if (!lbp->load()) {
+				std::cerr << "lbpcascade_frontalface_improved.xml not found, put it into the working directory" << std::endl;
+				return std::unique_ptr<DetectorBackend>();
+			}
+			return std::unique_ptr<DetectorBackend>(lbp.release());
+		}
+		std::cerr << name << " is no supported detector backend. Use haar or lbp" << std::endl;
+		return std::unique_ptr<DetectorBackend>();
+	}
+
+	// Returns the coordinates in stored pixels, the detection itself runs on the upright image
+	CoordinatePair findEyeCoords(std::string path, int orientation = 1, const DetectionParams& params = DetectionParams()) {
+		if (!detectorBackend) {
+			return CoordinatePair(); // initDetector wasn't called or failed
+		}
+
+		// Load image, orientation is applied while sampling so it matches the frame info
+		cv::Mat fullFrame = cv::imread(path, cv::IMREAD_COLOR | cv::IMREAD_IGNORE_ORIENTATION);
 		if (!fullFrame.data) {
 			return CoordinatePair(); // Couldnt load
 		}
+		float storedW = fullFrame.cols, storedH = fullFrame.rows;
+		bool transposed = orientation >= 5 && orientation <= 8;
+		cv::Rect upright(0, 0, transposed ? storedH : storedW, transposed ? storedW : storedH);
+		float m[6]; // upright to stored pixels
+		inverseOrientationMatrix(orientation, storedW, storedH, m);
 
-		// Scale for better performance
-		float scale = 400.0f / fullFrame.rows;
-		cv::Mat frame_gray;
-		cv::resize(fullFrame, frame_gray, cv::Size(), scale, scale);
+		// Scale for better performance, convert to gray and equalize in one pass
+		int hist[256];
+		uchar lut[256];
+		float scale = params.workingHeight / upright.height;
+		cv::Mat frame_gray = downscaleGray(fullFrame, m, upright, scale, scratch.frame, hist);
+		equalizeLut(hist, frame_gray.rows * frame_gray.cols, lut);
+		applyLut(frame_gray, lut);
 		//std::cout << frame_gray.rows << "h w" << frame_gray.cols << std::endl;
 
-		// Convert to gray
-		cv::cvtColor(frame_gray, frame_gray, cv::COLOR_BGR2GRAY);
-		cv::equalizeHist(frame_gray, frame_gray);
-
 		// Find faces
-		std::vector<cv::Rect> faces;
-		face_cascade.detectMultiScale(frame_gray, faces, 1.1, 10);
+		std::vector<cv::Rect>& faces = scratch.faces;
+		detectorBackend->findFaces(frame_gray, faces, params);
 
 		// Assure its only 1 face
 		if (faces.size() != 1) {
@@ -43,23 +223,11 @@ namespace facelapse {
 		//cv::rectangle(frame, faceRect, cv::Scalar(128, 128, 128), 3); // DEBUG
 		cv::Mat faceROI = frame_gray(faceRect);
 
-		// Find 2 eyes, using a Haar Cascade with a binary search for the paramenter
-		std::vector<cv::Rect> eyes;
-		int minE=2, maxE=100;
-		while (eyes.size() != 2) {
-			int avg = (minE + maxE) / 2;
-			if (avg == maxE || avg == minE) break;
-			eyes_cascade.detectMultiScale(faceROI, eyes, 1.3, avg);
-			//std::cout << "  Eyes parma=" << avg << " -> " << eyes.size() << std::endl; // DEBUG
-			if (eyes.size() > 2) {
-				minE = avg;
-			} else if (eyes.size() < 2) {
-				maxE = avg;
-			}
-		}
+		// Find 2 eyes
+		std::vector<cv::Rect>& eyes = scratch.eyes;
 
 		// Assure there are 2 eyes
-		if (eyes.size() != 2) {
+		if (!detectorBackend->findEyes(faceROI, eyes, params)) {
 			//std::cout << "eyes" << eyes.size() << std::endl;
 			return CoordinatePair(); // Detected too many or too few eyes 
 		}
@@ -80,20 +248,20 @@ namespace facelapse {
 			}
 
 			// Eye Rectangle
-			const float zoom = 0.75;
+			const float zoom = params.eyeZoom;
 			cv::Rect rect = cv::Rect(faceRect.x + eyes[k].x + eyes[k].width * (1-zoom) / 2, faceRect.y + eyes[k].y + eyes[k].height * (1-zoom) / 2, eyes[k].width*zoom, eyes[k].height*zoom);
-			cv::Rect fullRect = cv::Rect(rect.x / scale, rect.y / scale, rect.width / scale, rect.height / scale);
+			cv::Rect fullRect = cv::Rect(rect.x / scale, rect.y / scale, rect.width / scale, rect.height / scale) & upright;
+			if (fullRect.height <= 0 || fullRect.width <= 0) {
+				continue;
+			}
 
 			// std::cout << fullRect.height << "h w" << fullRect.width << std::endl;
 
-			// Gray, blurred ROI
-			cv::Mat eyeROI = fullFrame(fullRect);
-			float eyeScale = 70.0f / fullRect.height;
-			cv::resize(eyeROI, eyeROI, cv::Size(), eyeScale, eyeScale);
-			cv::cvtColor(eyeROI, eyeROI, cv::COLOR_BGR2GRAY);
-			cv::equalizeHist(eyeROI, eyeROI);
-			// cv::medianBlur(eyeROI, eyeROI, 5);
-			cv::threshold(eyeROI, eyeROI, 40, 255, cv::THRESH_BINARY);
+			// Gray, equalized and thresholded ROI: one sampling pass and one lookup pass
+			float eyeScale = params.eyeHeight / fullRect.height;
+			cv::Mat eyeROI = downscaleGray(fullFrame, m, fullRect, eyeScale, scratch.eye, hist);
+			equalizeThresholdLut(hist, eyeROI.rows * eyeROI.cols, params.threshold, lut);
+			applyLut(eyeROI, lut);
 			// cv::imshow("eye", eyeROI);
 
 			// One eye per eye please
@@ -102,7 +270,8 @@ namespace facelapse {
 			const float maxRadF = 0.33;
 
 			// Find the center in the gray scale image, using HoughCircles with a binary search for param2
-			std::vector<cv::Vec3f> circles;
+			std::vector<cv::Vec3f>& circles = scratch.circles;
+			circles.clear();
 			int min = 5, max = 50;
 			while (circles.size() != wantedCircles) {
 				int avg = (min + max) / 2;
@@ -127,15 +296,17 @@ namespace facelapse {
 		}
 		//std::cout << cp.rX << " " << cp.rY << std::endl;
 
+		// Back to stored pixels
+		if (cp.rX != -1) applyMatrix(m, cp.rX, cp.rY);
+		if (cp.lX != -1) applyMatrix(m, cp.lX, cp.lY);
+
 		return cp;
 	}
 
-	void initCascades() {
-		cv::FileStorage fsEye(EYE_CASCADE_STR, cv::FileStorage::MEMORY);
-		eyes_cascade.read(fsEye.getFirstTopLevelNode());
-
-		cv::FileStorage fsFace(FACE_CASCADE_STR, cv::FileStorage::MEMORY);
-		face_cascade.read(fsFace.getFirstTopLevelNode());
+	// Needs to be called once on every thread that detects
+	bool initDetector() {
+		detectorBackend = createBackend(detectorBackendName);
+		return detectorBackend != nullptr;
 	}
 
 	/*int emain(int argc, const char** argv) {
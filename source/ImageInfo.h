@@ -0,0 +1,325 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Threads.h"
+
+namespace facelapse {
+    struct FrameInfo {
+        int width = 0, height = 0; // as stored in the file, before orientation
+        int orientation = 1; // EXIF orientation, 1 is upright
+        std::string captureTime; // EXIF DateTimeOriginal "YYYY:MM:DD HH:MM:SS", empty if unknown
+        long long mtime = 0;
+        long long size = 0;
+        uint64_t hash = 0; // perceptual hash, see PerceptualHash.h
+        bool hasHash = false;
+    };
+
+    /*
+     * Affine map from stored pixel coordinates to upright coordinates for an EXIF orientation:
+     * x' = m[0]*x + m[1]*y + m[2], y' = m[3]*x + m[4]*y + m[5]. w and h are the stored dimensions.
+     */
+    void orientationMatrix(int orientation, float w, float h, float m[6]) {
+        const float table[9][6] = {
+            {1, 0, 0,   0, 1, 0}, // unused
+            {1, 0, 0,   0, 1, 0}, // 1: upright
+            {-1, 0, w,  0, 1, 0}, // 2: mirrored horizontally
+            {-1, 0, w,  0, -1, h}, // 3: rotated 180
+            {1, 0, 0,   0, -1, h}, // 4: mirrored vertically
+            {0, 1, 0,   1, 0, 0}, // 5: transposed
+            {0, -1, h,  1, 0, 0}, // 6: needs 90 clockwise rotation
+            {0, -1, h,  -1, 0, w}, // 7: transversed
+            {0, 1, 0,   -1, 0, w}, // 8: needs 90 counterclockwise rotation
+        };
+        if (orientation < 1 || orientation > 8) {
+            orientation = 1;
+        }
+        std::copy(table[orientation], table[orientation] + 6, m);
+    }
+
+    // Inverse of orientationMatrix, from upright coordinates back to stored pixel coordinates
+    void inverseOrientationMatrix(int orientation, float w, float h, float m[6]) {
+        float o[6];
+        orientationMatrix(orientation, w, h, o);
+        // The linear part is orthogonal, so its inverse is the transpose
+        m[0] = o[0]; m[1] = o[3];
+        m[3] = o[1]; m[4] = o[4];
+        m[2] = -(m[0] * o[2] + m[1] * o[5]);
+        m[5] = -(m[3] * o[2] + m[4] * o[5]);
+    }
+
+    void applyMatrix(const float m[6], float& x, float& y) {
+        float nx = m[0] * x + m[1] * y + m[2];
+        float ny = m[3] * x + m[4] * y + m[5];
+        x = nx;
+        y = ny;
+    }
+
+    // Rotates or mirrors the image upright, according to the EXIF orientation
+    void orientImage(cv::Mat& img, int orientation) {
+        if (orientation >= 5 && orientation <= 8) {
+            cv::transpose(img, img);
+        }
+        switch (orientation) {
+        case 2: case 6: cv::flip(img, img, 1); break;
+        case 3: case 7: cv::flip(img, img, -1); break;
+        case 4: case 8: cv::flip(img, img, 0); break;
+        default: break;
+        }
+    }
+
+    bool isImageFile(std::string path) {
+        size_t dot = path.find_last_of('.');
+        if (dot == std::string::npos) {
+            return false;
+        }
+        std::string ext = path.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        const char* supported[] = { "jpg", "jpeg", "png", "bmp", "tga", "gif", "psd", "hdr", "pic" };
+        for (auto s : supported) {
+            if (ext == s) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isDirectory(std::string path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    // All images in a directory (not recursive), sorted by name
+    std::vector<std::string> listDirectory(std::string dir) {
+        std::vector<std::string> ret;
+        while (dir.length() > 1 && dir[dir.length() - 1] == '/') {
+            dir.erase(dir.length() - 1);
+        }
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            return ret;
+        }
+        while (struct dirent* entry = readdir(d)) {
+            std::string name = entry->d_name;
+            if (name[0] != '.' && isImageFile(name)) {
+                ret.push_back(dir + "/" + name);
+            }
+        }
+        closedir(d);
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    }
+
+    // One path per line, directories are expanded. Empty lines and lines starting with # are ignored.
+    bool readManifest(std::string manifest, std::vector<std::string>& paths) {
+        std::ifstream file(manifest);
+        if (!file.good()) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            line.erase(0, line.find_first_not_of(" \t"));
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            if (isDirectory(line)) {
+                std::vector<std::string> content = listDirectory(line);
+                paths.insert(paths.end(), content.begin(), content.end());
+            } else {
+                paths.push_back(line);
+            }
+        }
+        return true;
+    }
+
+    bool statFile(std::string path, long long& mtime, long long& size) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+        mtime = st.st_mtime;
+        size = st.st_size;
+        return true;
+    }
+
+    unsigned int readU16(const unsigned char* p, bool littleEndian) {
+        return littleEndian ? (p[0] | p[1] << 8) : (p[0] << 8 | p[1]);
+    }
+
+    unsigned int readU32(const unsigned char* p, bool littleEndian) {
+        return littleEndian ? (p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24)
+                            : ((unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+    }
+
+    // Reads orientation and capture time from a TIFF structure, as embedded in the JPEG APP1 segment
+    void parseExif(const unsigned char* tiff, size_t len, FrameInfo& info) {
+        if (len < 8 || (tiff[0] != 'I' && tiff[0] != 'M')) {
+            return;
+        }
+        bool le = tiff[0] == 'I';
+        if (readU16(tiff + 2, le) != 42) {
+            return;
+        }
+
+        std::string dateTime, original;
+        unsigned int exifIfd = 0;
+        for (int k = 0; k < 2; k++) { // IFD0, then the Exif IFD it points to
+            unsigned int ifd = k == 0 ? readU32(tiff + 4, le) : exifIfd;
+            if (ifd == 0 || ifd + 2 > len) {
+                continue;
+            }
+            unsigned int count = readU16(tiff + ifd, le);
+            for (unsigned int i = 0; i < count; i++) {
+                size_t e = ifd + 2 + i * 12;
+                if (e + 12 > len) {
+                    break;
+                }
+                unsigned int tag = readU16(tiff + e, le);
+                if (tag == 0x0112) { // Orientation
+                    info.orientation = readU16(tiff + e + 8, le);
+                } else if (tag == 0x8769) { // Exif IFD pointer
+                    exifIfd = readU32(tiff + e + 8, le);
+                } else if (tag == 0x0132 || tag == 0x9003) { // DateTime, DateTimeOriginal
+                    unsigned int n = readU32(tiff + e + 4, le);
+                    size_t off = n <= 4 ? e + 8 : readU32(tiff + e + 8, le);
+                    if (off + n <= len) {
+                        std::string str((const char*)tiff + off, n);
+                        str = str.substr(0, str.find('\0'));
+                        (tag == 0x9003 ? original : dateTime) = str;
+                    }
+                }
+            }
+        }
+        info.captureTime = original.empty() ? dateTime : original;
+        if (info.orientation < 1 || info.orientation > 8) {
+            info.orientation = 1;
+        }
+    }
+
+    /*
+     * Reads dimensions, orientation and capture time from the file headers, without decoding any pixels.
+     * JPEG and PNG are understood, other formats only get the file stats.
+     */
+    bool readFrameInfo(std::string path, FrameInfo& info) {
+        info = FrameInfo();
+        if (!statFile(path, info.mtime, info.size)) {
+            return false;
+        }
+        std::ifstream file(path, std::ios::binary);
+        unsigned char buf[24];
+        if (!file.read((char*)buf, 2)) {
+            return true;
+        }
+
+        if (buf[0] == 0xFF && buf[1] == 0xD8) { // JPEG, walk the segments up to the image data
+            std::vector<unsigned char> segment;
+            while (file.read((char*)buf, 2)) {
+                if (buf[0] != 0xFF) {
+                    break;
+                }
+                unsigned char marker = buf[1];
+                while (marker == 0xFF && file.read((char*)&marker, 1)); // padding
+                if (marker == 0xD9 || marker == 0xDA) { // end of image or start of scan
+                    break;
+                }
+                if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) { // no length
+                    continue;
+                }
+                if (!file.read((char*)buf, 2)) {
+                    break;
+                }
+                unsigned int len = readU16(buf, false);
+                if (len < 2) {
+                    break;
+                }
+                len -= 2;
+                bool isSOF = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+                if (marker == 0xE1 || isSOF) {
+                    segment.resize(len);
+                    if (!file.read((char*)segment.data(), len)) {
+                        break;
+                    }
+                    if (isSOF && len >= 5) {
+                        info.height = readU16(segment.data() + 1, false);
+                        info.width = readU16(segment.data() + 3, false);
+                        break; // EXIF always precedes the frame header
+                    } else if (len > 6 && std::equal(segment.begin(), segment.begin() + 6, "Exif\0\0")) {
+                        parseExif(segment.data() + 6, len - 6, info);
+                    }
+                } else {
+                    file.seekg(len, std::ios::cur);
+                }
+            }
+        } else if (buf[0] == 0x89 && buf[1] == 'P') { // PNG, IHDR is always the first chunk
+            if (file.read((char*)buf, 22) && std::equal(buf + 10, buf + 14, "IHDR")) {
+                info.width = readU32(buf + 14, false);
+                info.height = readU32(buf + 18, false);
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Fills infos for all paths, scanning the headers in parallel. Entries whose modification time
+     * and size didn't change are kept, so a rescan only stats unchanged files.
+     */
+    void scanFrameInfos(const std::vector<std::string>& paths, std::map<std::string, FrameInfo>& infos) {
+        std::vector<std::string> todo;
+        for (auto& path : paths) {
+            long long mtime, size;
+            auto it = infos.find(path);
+            if (it == infos.end() || !statFile(path, mtime, size) || it->second.mtime != mtime || it->second.size != size) {
+                todo.push_back(path);
+            }
+        }
+        if (todo.empty()) {
+            return;
+        }
+
+        std::vector<FrameInfo> results(todo.size());
+        parallelFor(todo.size(), [&](size_t i) {
+            readFrameInfo(todo[i], results[i]);
+        });
+        for (size_t i = 0; i < todo.size(); i++) {
+            infos[todo[i]] = results[i];
+        }
+    }
+
+    // Capture time if known, modification time otherwise, as seconds since the epoch
+    long long captureSeconds(const FrameInfo& info) {
+        std::tm tm = {};
+        if (std::sscanf(info.captureTime.c_str(), "%d:%d:%d %d:%d:%d",
+                        &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+            return info.mtime;
+        }
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        return std::mktime(&tm);
+    }
+
+    // Capture time if known, modification time otherwise, in the EXIF format so both compare
+    std::string captureTimeKey(const FrameInfo& info) {
+        if (!info.captureTime.empty()) {
+            return info.captureTime;
+        }
+        std::time_t t = info.mtime;
+        char buf[20];
+        std::strftime(buf, sizeof(buf), "%Y:%m:%d %H:%M:%S", std::localtime(&t));
+        return buf;
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc.hpp"
+
+#include "ImageInfo.h"
+#include "Threads.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace facelapse {
+
+    int hammingDistance(uint64_t a, uint64_t b) {
+        return __builtin_popcountll(a ^ b);
+    }
+
+    /*
+     * 64 bit DCT hash of the upright frame: the lowest 8x8 frequencies of a 32x32 grayscale version,
+     * each bit tells whether a coefficient is above the median. Similar pictures have a small Hamming distance.
+     */
+    bool perceptualHash(std::string path, int orientation, uint64_t& hash) {
+        // The JPEG decoder only needs to produce an eighth of the resolution
+        cv::Mat img = cv::imread(path, cv::IMREAD_REDUCED_GRAYSCALE_8 | cv::IMREAD_IGNORE_ORIENTATION);
+        if (img.empty()) {
+            return false;
+        }
+        orientImage(img, orientation);
+
+        cv::Mat small, coeffs;
+        cv::resize(img, small, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
+        small.convertTo(small, CV_32F);
+        cv::dct(small, coeffs);
+
+        float low[64];
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                low[y * 8 + x] = coeffs.at<float>(y, x);
+            }
+        }
+        float sorted[63];
+        std::copy(low + 1, low + 64, sorted); // without the average brightness
+        std::nth_element(sorted, sorted + 31, sorted + 63);
+        float median = sorted[31];
+
+        hash = 0;
+        for (int i = 0; i < 64; i++) {
+            hash = hash << 1 | (low[i] > median);
+        }
+        return true;
+    }
+
+    // Hashes all frames that don't have one yet, in parallel
+    void hashFrames(const std::vector<std::string>& paths, std::map<std::string, FrameInfo>& infos) {
+        std::vector<FrameInfo*> todo;
+        std::vector<std::string> todoPaths;
+        for (auto& path : paths) {
+            FrameInfo& info = infos[path];
+            if (!info.hasHash) {
+                todo.push_back(&info);
+                todoPaths.push_back(path);
+            }
+        }
+
+        parallelFor(todo.size(), [&](size_t i) {
+            todo[i]->hasHash = perceptualHash(todoPaths[i], todo[i]->orientation, todo[i]->hash);
+        });
+    }
+
+    /*
+     * BK-tree over perceptual hashes for Hamming distance queries. Children are indexed by their
+     * distance to the parent, so the triangle inequality limits a search to a few branches.
+     */
+    class HashIndex {
+    public:
+        void insert(uint64_t hash, long id) {
+            Node node;
+            node.hash = hash;
+            node.id = id;
+            std::fill(node.children, node.children + 65, -1);
+            nodes.push_back(node);
+
+            int added = nodes.size() - 1;
+            int cur = 0;
+            while (cur != added) {
+                int& child = nodes[cur].children[hammingDistance(nodes[cur].hash, hash)];
+                if (child == -1) {
+                    child = added;
+                }
+                cur = child;
+            }
+        }
+
+        // Id of an indexed hash at most maxDistance away that is accepted, -1 if there is none
+        long findNear(uint64_t hash, int maxDistance, const std::function<bool(long)>& accept) const {
+            if (nodes.empty()) {
+                return -1;
+            }
+            std::vector<int> stack(1, 0);
+            while (!stack.empty()) {
+                const Node& node = nodes[stack.back()];
+                stack.pop_back();
+                int d = hammingDistance(node.hash, hash);
+                if (d <= maxDistance && accept(node.id)) {
+                    return node.id;
+                }
+                for (int k = std::max(0, d - maxDistance); k <= std::min(64, d + maxDistance); k++) {
+                    if (node.children[k] != -1) {
+                        stack.push_back(node.children[k]);
+                    }
+                }
+            }
+            return -1;
+        }
+
+    private:
+        struct Node {
+            uint64_t hash;
+            long id;
+            int children[65];
+        };
+        std::vector<Node> nodes;
+    };
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace facelapse {
+
+    /*
+     * Reusable buffers for the detection of one thread. Mats are headers over the vectors, which
+     * only grow, so after the first frames no further memory is allocated.
+     */
+    struct ScratchBuffer {
+        std::vector<uchar> data;
+
+        cv::Mat mat(int rows, int cols) {
+            size_t needed = (size_t)std::max(rows, 1) * std::max(cols, 1);
+            if (data.size() < needed) {
+                data.resize(needed);
+            }
+            return cv::Mat(rows, cols, CV_8UC1, data.data());
+        }
+    };
+
+    /*
+     * Downscales a region of a BGR image, converts it to gray and builds its histogram in one pass.
+     *
+     * roi is given in upright coordinates, m maps upright to stored coordinates (see inverseOrientationMatrix),
+     * so the image never has to be rotated itself. Sampling is bilinear like cv::resize with INTER_LINEAR,
+     * the gray weights are those of cv::cvtColor.
+     */
+    cv::Mat downscaleGray(const cv::Mat& bgr, const float m[6], cv::Rect roi, float scale, ScratchBuffer& buffer, int hist[256]) {
+        int rows = std::max(1, (int)std::lround(roi.height * scale));
+        int cols = std::max(1, (int)std::lround(roi.width * scale));
+        cv::Mat dst = buffer.mat(rows, cols);
+        std::fill(hist, hist + 256, 0);
+
+        const int maxX = bgr.cols - 1, maxY = bgr.rows - 1;
+        const uchar* base = bgr.data;
+        const size_t step = bgr.step;
+        auto gray = [base, step](int x, int y) {
+            const uchar* p = base + y * step + x * 3;
+            return (p[0] * 1868 + p[1] * 9617 + p[2] * 4899 + (1 << 13)) >> 14;
+        };
+
+        for (int y = 0; y < rows; y++) {
+            uchar* out = dst.ptr<uchar>(y);
+            float uy = roi.y + (y + 0.5f) / scale;
+            for (int x = 0; x < cols; x++) {
+                float ux = roi.x + (x + 0.5f) / scale;
+                float sx = m[0] * ux + m[1] * uy + m[2] - 0.5f;
+                float sy = m[3] * ux + m[4] * uy + m[5] - 0.5f;
+                sx = std::min(std::max(sx, 0.0f), (float)maxX);
+                sy = std::min(std::max(sy, 0.0f), (float)maxY);
+
+                int x0 = (int)sx, y0 = (int)sy;
+                int x1 = std::min(x0 + 1, maxX), y1 = std::min(y0 + 1, maxY);
+                int wx = (int)((sx - x0) * 256), wy = (int)((sy - y0) * 256);
+
+                int top = gray(x0, y0) * (256 - wx) + gray(x1, y0) * wx;
+                int bottom = gray(x0, y1) * (256 - wx) + gray(x1, y1) * wx;
+                int v = (top * (256 - wy) + bottom * wy + (1 << 15)) >> 16;
+
+                out[x] = (uchar)v;
+                hist[v]++;
+            }
+        }
+        return dst;
+    }
+
+    // Lookup table of the histogram equalization, computed like cv::equalizeHist
+    void equalizeLut(const int hist[256], int total, uchar lut[256]) {
+        int i = 0;
+        while (i < 255 && !hist[i]) {
+            i++;
+        }
+        if (hist[i] == total) { // only one value
+            std::fill(lut, lut + 256, (uchar)i);
+            return;
+        }
+        float scale = 255.0f / (total - hist[i]);
+        std::fill(lut, lut + i + 1, 0);
+        int sum = 0;
+        for (i++; i < 256; i++) {
+            sum += hist[i];
+            lut[i] = (uchar)std::min(255L, std::lround(sum * scale));
+        }
+    }
+
+    // Equalization followed by a binary threshold, as a single lookup table
+    void equalizeThresholdLut(const int hist[256], int total, int threshold, uchar lut[256]) {
+        equalizeLut(hist, total, lut);
+        for (int i = 0; i < 256; i++) {
+            lut[i] = lut[i] > threshold ? 255 : 0;
+        }
+    }
+
+    void applyLut(cv::Mat& img, const uchar lut[256]) {
+        for (int y = 0; y < img.rows; y++) {
+            uchar* p = img.ptr<uchar>(y);
+            for (int x = 0; x < img.cols; x++) {
+                p[x] = lut[p[x]];
+            }
+        }
+    }
+}
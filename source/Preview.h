@@ -0,0 +1,168 @@
+#pragma once
+
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc.hpp"
+
+#include <SFML/Graphics.hpp>
+
+#include "Threads.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace facelapse {
+
+    /*
+     * Streams low resolution versions of the frames for the timelapse preview.
+     *
+     * Background workers decode the frames ahead of the playhead into a ring buffer of a fixed number
+     * of slots, so memory stays bounded no matter how many frames the project has. If all frames fit
+     * into the ring, they stay cached and are only decoded once.
+     */
+    class PreviewPlayer {
+    public:
+        PreviewPlayer(const std::vector<std::string>& frameSet, int previewHeight, size_t maxFrames)
+            : frames(frameSet), height(previewHeight), capacity(std::min(maxFrames, frameSet.size())),
+              slots(capacity), playhead(0), nextSeq(0), stopping(false), fullHeightHint(0)
+        { }
+
+        ~PreviewPlayer() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            cond.notify_all();
+            for (auto& t : workers) {
+                t.join();
+            }
+        }
+
+        void start() {
+            if (!workers.empty() || capacity == 0) {
+                return;
+            }
+            unsigned int n = backgroundThreadCount();
+            for (unsigned int i = 0; i < n; i++) {
+                workers.push_back(std::thread(&PreviewPlayer::work, this));
+            }
+        }
+
+        // Uploads the frame at the playhead into tex, false if it isn't loaded yet.
+        // scale is the preview size relative to the original frame.
+        bool show(sf::Texture& tex, float& scale, size_t& frameIndex) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (capacity == 0) {
+                return false;
+            }
+            Slot& slot = slots[playhead % capacity];
+            if (slot.seq != playhead) {
+                return false;
+            }
+            if (tex.getSize() != sf::Vector2u(slot.width, slot.height)) {
+                tex.create(slot.width, slot.height);
+            }
+            tex.update(slot.pixels.data());
+            scale = slot.scale;
+            frameIndex = slot.frame;
+            return true;
+        }
+
+        // Moves on to the next frame, wrapping around at the end. Only call after show() succeeded.
+        void advance() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                playhead++;
+            }
+            cond.notify_all();
+        }
+
+    private:
+        struct Slot {
+            long seq = -1; // position in the endless playback sequence
+            long frame = -1;
+            unsigned int width = 0, height = 0;
+            float scale = 1;
+            std::vector<sf::Uint8> pixels;
+        };
+
+        std::vector<std::string> frames;
+        int height;
+        size_t capacity;
+        std::vector<Slot> slots;
+        long playhead;
+        long nextSeq;
+        bool stopping;
+
+        std::atomic<int> fullHeightHint; // height of the last decoded original, to pick the decoder reduction
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        void work() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                if (nextSeq >= playhead + (long)capacity) { // ring is full
+                    cond.wait(lock);
+                    continue;
+                }
+                long seq = nextSeq++;
+                long frame = seq % frames.size();
+                Slot& slot = slots[seq % capacity];
+                if (slot.frame == frame) { // still cached from the last round
+                    slot.seq = seq;
+                    continue;
+                }
+
+                lock.unlock();
+                Slot loaded;
+                decode(frames[frame], loaded);
+                lock.lock();
+
+                loaded.seq = seq;
+                loaded.frame = frame;
+                std::swap(slot, loaded);
+            }
+        }
+
+        void decode(const std::string& path, Slot& slot) {
+            // Let the JPEG decoder skip most of the work, based on the size of the previous frame
+            int hint = fullHeightHint;
+            int reduction = 1;
+            int flag = cv::IMREAD_COLOR;
+            if (hint >= height * 8) {
+                reduction = 8;
+                flag = cv::IMREAD_REDUCED_COLOR_8;
+            } else if (hint >= height * 4) {
+                reduction = 4;
+                flag = cv::IMREAD_REDUCED_COLOR_4;
+            } else if (hint >= height * 2) {
+                reduction = 2;
+                flag = cv::IMREAD_REDUCED_COLOR_2;
+            }
+
+            cv::Mat img = cv::imread(path, flag | cv::IMREAD_IGNORE_ORIENTATION); // orientation is part of the transform
+            if (img.empty()) {
+                slot.width = slot.height = 1;
+                slot.pixels.assign(4, 0);
+                return;
+            }
+            fullHeightHint = img.rows * reduction;
+
+            float scale = std::min(1.0f, (float)height / img.rows);
+            if (scale < 1) {
+                cv::resize(img, img, cv::Size(), scale, scale, cv::INTER_AREA);
+            }
+            slot.width = img.cols;
+            slot.height = img.rows;
+            slot.scale = scale / reduction;
+            slot.pixels.resize(img.cols * img.rows * 4);
+            cv::Mat rgba(img.rows, img.cols, CV_8UC4, slot.pixels.data());
+            cv::cvtColor(img, rgba, cv::COLOR_BGR2RGBA);
+        }
+    };
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+// Needed for the pixel buffer object entry points (GL 2.1), which libGL exports directly on Linux
+#define GL_GLEXT_PROTOTYPES
+#include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+namespace facelapse {
+
+    /*
+     * Renders frames into a persistent render target and reads them back asynchronously.
+     *
+     * The render target, the source texture and two pixel buffer objects are kept alive between frames
+     * and only recreated when the output size changes. Readback is double-buffered: the pixels of a
+     * frame are requested into one PBO while the previous frame is mapped from the other, so the GPU
+     * (or Mesa's software rasterizer) keeps working while the CPU copies. The view is flipped vertically,
+     * which makes glReadPixels return rows top to bottom, so no CPU flip is needed.
+     *
+     * render() returns the frame submitted on the previous call, flush() returns the last one. Both return
+     * nullptr if there is no such frame or it couldn't be read back, so nothing is saved for it.
+     */
+    class FrameRenderer {
+    public:
+        FrameRenderer() : width(0), height(0), usePBO(false), current(0), pending(false) {
+            pbos[0] = pbos[1] = 0;
+        }
+
+        ~FrameRenderer() {
+            releaseBuffers();
+        }
+
+        std::unique_ptr<sf::Image> render(const std::string& frameName, const sf::Transform& transform,
+                                          unsigned int w, unsigned int h, sf::Color bgColor) {
+            if (!prepareTarget(w, h)) {
+                return std::unique_ptr<sf::Image>(); // nothing to save, also no frame pending anymore
+            }
+
+            target.clear(bgColor);
+            if (loadFrame(frameName)) {
+                target.draw(sprite, transform);
+            } else {
+                std::cerr << "error loading frame " << frameName << std::endl;
+            }
+            target.display();
+            target.setActive(true);
+
+            std::unique_ptr<sf::Image> previous;
+            if (usePBO) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[current]);
+                glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0); // returns immediately
+                if (pending) {
+                    previous = mapBuffer(pbos[1 - current]);
+                }
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                current = 1 - current;
+            } else {
+                if (pending) {
+                    previous = std::move(held);
+                }
+                pixels.resize(width * height * 4);
+                glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+                held.reset(new sf::Image());
+                held->create(width, height, pixels.data());
+            }
+            pending = true;
+            return previous;
+        }
+
+        std::unique_ptr<sf::Image> flush() {
+            if (!pending) {
+                return std::unique_ptr<sf::Image>();
+            }
+            pending = false;
+            if (!usePBO) {
+                return std::move(held);
+            }
+            target.setActive(true);
+            std::unique_ptr<sf::Image> last = mapBuffer(pbos[1 - current]);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            return last;
+        }
+
+    private:
+        sf::RenderTexture target;
+        sf::Texture texture;
+        sf::Image source;
+        sf::Sprite sprite;
+
+        unsigned int width, height;
+        bool usePBO;
+        GLuint pbos[2];
+        int current;
+        bool pending;
+
+        // Fallback readback without PBOs
+        std::vector<sf::Uint8> pixels;
+        std::unique_ptr<sf::Image> held;
+
+        bool prepareTarget(unsigned int w, unsigned int h) {
+            if (w == width && h == height) {
+                return true;
+            }
+            releaseBuffers();
+            if (!target.create(w, h)) {
+                std::cerr << "couldn't create a " << w << "x" << h << " render target" << std::endl;
+                width = height = 0;
+                pending = false;
+                return false;
+            }
+            width = w;
+            height = h;
+            target.setView(sf::View(sf::FloatRect(0, height, width, -(float)height)));
+
+            target.setActive(true);
+            usePBO = supportsPBO();
+            if (usePBO) {
+                glGenBuffers(2, pbos);
+                for (int i = 0; i < 2; i++) {
+                    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+                    glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, 0, GL_STREAM_READ);
+                }
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            }
+            current = 0;
+            pending = false;
+            return true;
+        }
+
+        void releaseBuffers() {
+            if (pbos[0] != 0) {
+                target.setActive(true);
+                glDeleteBuffers(2, pbos);
+                pbos[0] = pbos[1] = 0;
+            }
+            held.reset();
+        }
+
+        bool loadFrame(const std::string& frameName) {
+            if (!source.loadFromFile(frameName)) {
+                return false;
+            }
+            if (source.getSize() == texture.getSize()) {
+                texture.update(source); // Reuse the texture storage
+            } else if (!texture.loadFromImage(source)) {
+                return false;
+            }
+            sprite.setTexture(texture, true);
+            return true;
+        }
+
+        std::unique_ptr<sf::Image> mapBuffer(GLuint pbo) {
+            std::unique_ptr<sf::Image> img;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            const sf::Uint8* data = static_cast<const sf::Uint8*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+            if (data) {
+                img.reset(new sf::Image());
+                img->create(width, height, data);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            } else {
+                std::cerr << "couldn't map the pixel buffer" << std::endl;
+            }
+            return img;
+        }
+
+        // PBOs are core since GL 2.1, older contexts may still expose the extension
+        static bool supportsPBO() {
+            const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+            int major = 0, minor = 0;
+            if (version && std::sscanf(version, "%d.%d", &major, &minor) == 2) {
+                if (major > 2 || (major == 2 && minor >= 1)) {
+                    return true;
+                }
+            }
+            const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+            return extensions && std::strstr(extensions, "GL_ARB_pixel_buffer_object");
+        }
+    };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace facelapse {
+
+    // Threads for work in the background of the window, one core is left for it
+    unsigned int backgroundThreadCount() {
+        return std::max(2u, std::thread::hardware_concurrency()) - 1;
+    }
+
+    // Calls fn for every index below count, spread over all cores. Returns the number of threads used.
+    unsigned int parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+        unsigned int n = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), std::max<size_t>(1, count));
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < n; t++) {
+            workers.push_back(std::thread([&]() {
+                for (size_t i = next++; i < count; i = next++) {
+                    fn(i);
+                }
+            }));
+        }
+        for (auto& t : workers) {
+            t.join();
+        }
+        return n;
+    }
+}
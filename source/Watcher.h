@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ImageInfo.h"
+
+#include <cerrno>
+#include <deque>
+#include <map>
+#include <string>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace facelapse {
+
+    /*
+     * Reports images that are written or moved into watched folders, using inotify.
+     * Folders created inside a watched folder (e.g. one per day) are watched as well.
+     */
+    class FolderWatcher {
+    public:
+        FolderWatcher() : fd(inotify_init1(IN_CLOEXEC)) { }
+
+        ~FolderWatcher() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        bool add(std::string dir) {
+            while (dir.length() > 1 && dir[dir.length() - 1] == '/') {
+                dir.erase(dir.length() - 1);
+            }
+            int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+            if (wd < 0) {
+                return false;
+            }
+            dirs[wd] = dir;
+            return true;
+        }
+
+        // Blocks until an image is complete. False if interrupted by a signal or on errors.
+        bool next(std::string& path) {
+            while (pending.empty()) {
+                ssize_t len = read(fd, buf, sizeof(buf));
+                if (len <= 0) {
+                    return false; // EINTR when stopped by a signal
+                }
+                for (char* p = buf; p < buf + len; ) {
+                    const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+                    p += sizeof(inotify_event) + ev->len;
+                    if (ev->len == 0 || dirs.count(ev->wd) == 0) {
+                        continue;
+                    }
+                    std::string name = dirs[ev->wd] + "/" + ev->name;
+                    if (ev->mask & IN_ISDIR) {
+                        // A new folder, the files that arrived before watching it are reported too
+                        if (add(name)) {
+                            std::vector<std::string> content = listDirectory(name);
+                            pending.insert(pending.end(), content.begin(), content.end());
+                        }
+                    } else if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && isImageFile(name)) {
+                        pending.push_back(name);
+                    }
+                }
+            }
+            path = pending.front();
+            pending.pop_front();
+            return true;
+        }
+
+    private:
+        int fd;
+        std::map<int, std::string> dirs;
+        std::deque<std::string> pending;
+        alignas(inotify_event) char buf[64 * 1024];
+    };
+}
@@ -1,17 +1,35 @@
 #include <iostream>
 #include <fstream>
 #include <thread>
+#include <memory>
 #include <cmath>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <sstream>
 
 #include <SFML/Graphics.hpp>
 #include "json.hpp"
 using json = nlohmann::json;
 
 #include "Header.h"
+#include "ImageInfo.h"
 #include "EyeDetection.h"
+#include "Renderer.h"
+#include "Preview.h"
+#include "Evaluation.h"
+#include "Watcher.h"
+#include "PerceptualHash.h"
+#include "DetectionQueue.h"
 
 #define ASSERT(exp, msg) if (!(exp)) { std::cerr << msg << std::endl; return -1;}
 #define WINDOWHEIGHT 720
+#define PREVIEWHEIGHT 360
+#define PREVIEWFRAMES 96
+#define PREVIEWFPS 15
+#define DUPLICATESECONDS 10 // burst shots and re-uploads, daily pictures look alike on purpose
 
 namespace facelapse {
     namespace jsonKeys {
@@ -22,9 +40,25 @@ namespace facelapse {
             const std::string eyeHeight = "eye_height";
             const std::string eyeSpacing = "eye_spacing";
         }
+        namespace info {
+            const std::string width = "width";
+            const std::string height = "height";
+            const std::string orientation = "orientation";
+            const std::string captureTime = "capture_time";
+            const std::string mtime = "mtime";
+            const std::string size = "size";
+            const std::string hash = "phash";
+        }
         const std::string outputsettings = "output_settings";
         const std::string coordinates = "coordinate_pairs";
+        const std::string frameInfo = "frame_info";
+        const std::string detector = "detector";
         const std::string version = "version";
+        namespace journal {
+            const std::string frame = "frame";
+            const std::string coordinates = "coordinates";
+            const std::string info = "info";
+        }
     }
    
 
@@ -80,6 +114,29 @@ namespace facelapse {
         obj.eyeSpacing = j.at(jsonKeys::settings::eyeSpacing).get<float>();
     }
 
+    void to_json(json& j, const FrameInfo& obj) {
+        j = json { {jsonKeys::info::width, obj.width}, {jsonKeys::info::height, obj.height},
+        {jsonKeys::info::orientation, obj.orientation}, {jsonKeys::info::captureTime, obj.captureTime},
+        {jsonKeys::info::mtime, obj.mtime}, {jsonKeys::info::size, obj.size} };
+        if (obj.hasHash) {
+            std::stringstream ss;
+            ss << std::hex << obj.hash;
+            j[jsonKeys::info::hash] = ss.str();
+        }
+    }
+    void from_json(const json& j, FrameInfo& obj) {
+        obj.width = j.at(jsonKeys::info::width).get<int>();
+        obj.height = j.at(jsonKeys::info::height).get<int>();
+        obj.orientation = j.at(jsonKeys::info::orientation).get<int>();
+        obj.captureTime = j.at(jsonKeys::info::captureTime).get<std::string>();
+        obj.mtime = j.at(jsonKeys::info::mtime).get<long long>();
+        obj.size = j.at(jsonKeys::info::size).get<long long>();
+        obj.hasHash = j.count(jsonKeys::info::hash) != 0;
+        if (obj.hasHash) {
+            obj.hash = std::stoull(j.at(jsonKeys::info::hash).get<std::string>(), nullptr, 16);
+        }
+    }
+
     enum ReturnStatus {
         Saved,
         Canceled
@@ -87,7 +144,9 @@ namespace facelapse {
 
 
     json coordinatePairs;
+    std::map<std::string, FrameInfo> frameInfos;
     std::string dataFileName;
+    std::string savedBackendName; // only replaced by a backend that frames were detected with
 
     OutputSettings outSettings;
 
@@ -117,21 +176,26 @@ namespace facelapse {
         return t;
     }
 
-    sf::Image transformFrameGL(std::string frameName, OutputSettings out = outSettings) {
-        sf::RenderTexture renderTex;
-        renderTex.create(out.width, out.height);
-        renderTex.clear(out.bgColor);
-
-        sf::Texture tex;
-        tex.loadFromFile(frameName);
-        sf::Sprite sprite(tex);
-
-        sf::Transform transform = calculateTransform(coordinatePairs[frameName], out);
-        renderTex.draw(sprite, transform);
+    // Maps stored pixels of a frame to upright pixels, according to its EXIF orientation
+    sf::Transform orientationTransform(std::string frameName) {
+        FrameInfo info;
+        auto it = frameInfos.find(frameName);
+        if (it != frameInfos.end()) {
+            info = it->second;
+        }
+        float m[6];
+        orientationMatrix(info.orientation, info.width, info.height, m);
+        return sf::Transform(m[0], m[1], m[2], m[3], m[4], m[5], 0, 0, 1);
+    }
 
-        auto img = renderTex.getTexture().copyToImage();
-        img.flipVertically();
-        return img;
+    // Transform of a frame as stored on disk into the output. The coordinates are in stored pixels,
+    // the eyes are aligned in the upright frame so mirrored orientations come out right.
+    sf::Transform frameTransform(std::string frameName, OutputSettings out) {
+        sf::Transform orient = orientationTransform(frameName);
+        CoordinatePair cp = coordinatePairs[frameName];
+        sf::Vector2f r = orient.transformPoint(cp.rX, cp.rY);
+        sf::Vector2f l = orient.transformPoint(cp.lX, cp.lY);
+        return calculateTransform(CoordinatePair(r.x, r.y, l.x, l.y), out) * orient;
     }
 
     ReturnStatus demandEyePositioning() {
@@ -152,15 +216,24 @@ namespace facelapse {
 
         OutputSettings settings(wWidth, wHeight, outSettings.bgColor, outSettings.eyeHeight, outSettings.eyeSpacing);
 
+        // Timelapse preview, the frames are only loaded once it's started
+        PreviewPlayer preview(frames, PREVIEWHEIGHT, PREVIEWFRAMES);
+        sf::Texture previewTex;
+        sf::Sprite previewSprite;
+        float previewScale = 1;
+        size_t previewFrame = 0;
+        sf::Clock frameClock;
+        bool playing = false;
+
         bool needsRepaint = true;
 
         while (window.isOpen()) {
             sf::Event event;
-            while (!needsRepaint && window.waitEvent(event)) {
+            while (!needsRepaint && (playing ? window.pollEvent(event) : window.waitEvent(event))) {
                 switch (event.type) {
                 case sf::Event::Closed : // Close
                     return Canceled;
-                case sf::Event::KeyPressed : // Escape and Return
+                case sf::Event::KeyPressed : // Escape, Return and Space
                     if (event.key.code == sf::Keyboard::Escape) 
                         return Canceled;
                     if (event.key.code == sf::Keyboard::Return) {
@@ -168,6 +241,16 @@ namespace facelapse {
                         outSettings.eyeSpacing = settings.eyeSpacing;
                         return Saved;
                     }
+                    if (event.key.code == sf::Keyboard::Space) {
+                        playing = !playing;
+                        if (playing) {
+                            preview.start();
+                            frameClock.restart();
+                        } else {
+                            window.setTitle("Face Lapse Utility");
+                        }
+                        needsRepaint = true;
+                    }
                     break;
                 case sf::Event::MouseMoved : // Drag
                     if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Left)){
@@ -197,13 +280,32 @@ namespace facelapse {
                 }
             }
 
+            // Next preview frame, stalls until the background loader caught up
+            if (playing && frameClock.getElapsedTime().asSeconds() >= 1.0f / PREVIEWFPS) {
+                if (preview.show(previewTex, previewScale, previewFrame)) {
+                    previewSprite.setTexture(previewTex, true);
+                    preview.advance();
+                    frameClock.restart();
+                    window.setTitle("Face Lapse Utility (preview " + std::to_string(previewFrame+1) + "/" + std::to_string(frames.size()) + ")");
+                    needsRepaint = true;
+                }
+            }
+
             if (needsRepaint) {
                 window.clear(outSettings.bgColor);
 
-                sf::Transform t = calculateTransform(coordinatePairs[frames[0]], settings);
-                window.draw(photo, t);
+                if (playing && previewTex.getSize().x > 0) {
+                    sf::Transform t = frameTransform(frames[previewFrame], settings);
+                    t.scale(1 / previewScale, 1 / previewScale); // preview pixels to original pixels
+                    window.draw(previewSprite, t);
+                } else {
+                    sf::Transform t = frameTransform(frames[0], settings);
+                    window.draw(photo, t);
+                }
                 needsRepaint = false;
                 window.display();
+            } else if (playing) {
+                sf::sleep(sf::milliseconds(2));
             }
         }
         return Canceled;
@@ -223,14 +325,49 @@ namespace facelapse {
         return ret;
     }
 
-    
+    // Fills the missing eyes of stored with the detected ones, eyes that were placed by hand are kept
+    CoordinatePair mergeDetection(CoordinatePair stored, CoordinatePair found) {
+        if (stored.rX == -1 && found.rX != -1) {
+            stored.rX = found.rX;
+            stored.rY = found.rY;
+        }
+        if (stored.lX == -1 && found.lX != -1) {
+            stored.lX = found.lX;
+            stored.lY = found.lY;
+        }
+        return stored;
+    }
 
     ReturnStatus fillData(std::vector<std::string> frameSet, bool autoDetect) {
-        initCascades();
+        // The backend is checked on first use, without it the frames can still be positioned by hand
+        int backendAvailable = -1;
+        auto canDetect = [&backendAvailable]() {
+            if (backendAvailable == -1) {
+                backendAvailable = createBackend(detectorBackendName) != nullptr;
+                if (!backendAvailable) {
+                    std::cerr << "Detector backend " << detectorBackendName << " unavailable, automatic detection is disabled" << std::endl;
+                }
+            }
+            return backendAvailable == 1;
+        };
+        if (autoDetect && !canDetect()) {
+            autoDetect = false;
+        }
+
+        // Detection runs in the background, starting with the frames around the current one
+        std::vector<int> orientations;
+        std::vector<bool> sweep;
+        for (auto& f : frameSet) {
+            orientations.push_back(frameInfos[f].orientation);
+            CoordinatePair cp = coordinatePairs[f];
+            sweep.push_back(autoDetect && !cp.isComplete());
+        }
+        DetectionQueue detector(frameSet, orientations, sweep);
+        detector.start();
 
         int loadNumber = 0;
         int currentNumber = -1;
-        float currentScale = 1;
+        sf::Transform photoTransform; // stored pixels to window, upright and scaled to fit
 
         window.setVisible(true);
 
@@ -243,7 +380,7 @@ namespace facelapse {
 
         while (window.isOpen()) {
             sf::Event event;
-            while (!needsRepaint && window.waitEvent(event)) {
+            while (!needsRepaint && (detector.idle() ? window.waitEvent(event) : window.pollEvent(event))) {
                 switch (event.type) {
                 case sf::Event::Closed :
                     return Canceled;
@@ -253,6 +390,17 @@ namespace facelapse {
                     }
                     if (event.key.code == sf::Keyboard::Return) {
                         coordinatePairs[frameSet[currentNumber]] = currPair;
+                        if (detector.detectedAny()) {
+                            savedBackendName = detectorBackendName;
+                        }
+                        // Detected frames that weren't visited, eyes placed by hand are kept
+                        for (size_t i = 0; i < frameSet.size(); i++) {
+                            CoordinatePair stored = coordinatePairs[frameSet[i]];
+                            CoordinatePair found;
+                            if (!stored.isComplete() && detector.result(i, found)) {
+                                coordinatePairs[frameSet[i]] = mergeDetection(stored, found);
+                            }
+                        }
                         return Saved;
                     }
                     if (event.key.code == sf::Keyboard::Right) {
@@ -265,14 +413,15 @@ namespace facelapse {
                         loadNumber = std::max(currentNumber - 1, 0);
                         needsRepaint = true;
                     }
-                    if (event.key.code == sf::Keyboard::Space) {
-                        currPair = findEyeCoords(frameSet[currentNumber]);
-                        needsRepaint = true;
+                    if (event.key.code == sf::Keyboard::Space && canDetect()) {
+                        detector.request(currentNumber); // markers update once it's done
                     }
                     break;
                 case sf::Event::MouseButtonPressed : {
-                    float x = event.mouseButton.x / currentScale;
-                    float y = event.mouseButton.y / currentScale;
+                    sf::Vector2f p = photoTransform.getInverse().transformPoint(event.mouseButton.x, event.mouseButton.y);
+                    float x = p.x;
+                    float y = p.y;
+                    detector.cancel(currentNumber);
 
                     if (event.mouseButton.button == sf::Mouse::Right) {
                         currPair.lX = x;
@@ -300,16 +449,20 @@ namespace facelapse {
             // Load new frame if necessary
             if (loadNumber != -1) {
                 if (tex.loadFromFile(frameSet[loadNumber])) {
-                    photo.setTexture(tex);
-                    float scaleX = (float)window.getSize().x / tex.getSize().x;
-                    float scaleY = (float)window.getSize().y / tex.getSize().y;
-                    currentScale = std::min(scaleX, scaleY); // Scale to fit screen
-                    photo.setScale(currentScale, currentScale);
+                    photo.setTexture(tex, true);
+                    sf::Transform orient = orientationTransform(frameSet[loadNumber]);
+                    sf::FloatRect bounds = orient.transformRect(sf::FloatRect(0, 0, tex.getSize().x, tex.getSize().y));
+                    float scaleX = (float)window.getSize().x / bounds.width;
+                    float scaleY = (float)window.getSize().y / bounds.height;
+                    float currentScale = std::min(scaleX, scaleY); // Scale to fit screen
+                    photoTransform = sf::Transform().scale(currentScale, currentScale) * orient;
 
                     currPair = coordinatePairs[frameSet[loadNumber]];
-                    if (autoDetect && !currPair.isComplete()) {
-                        currPair = findEyeCoords(frameSet[loadNumber]);
+                    CoordinatePair found;
+                    if (autoDetect && !currPair.isComplete() && detector.result(loadNumber, found)) { // if it's detected already
+                        currPair = mergeDetection(currPair, found);
                     }
+                    detector.setCursor(loadNumber);
                     window.setTitle("Face Lapse Utility (" + std::to_string(loadNumber+1) + "/" + std::to_string(frameSet.size()) + ")");
                     currentNumber = loadNumber;
                     needsRepaint = true;
@@ -319,13 +472,20 @@ namespace facelapse {
                 loadNumber = -1;
             }
 
+            // Detection of the current frame arrived
+            CoordinatePair found;
+            if (currentNumber != -1 && detector.fetchNew(currentNumber, found)) {
+                currPair = found;
+                needsRepaint = true;
+            }
+
             if (needsRepaint) {
                 window.clear(sf::Color::White);
-                window.draw(photo);
+                window.draw(photo, photoTransform);
 
                 // Draw Eye indicators
                 if (currPair.rX != -1) {
-                    sf::Vector2f pos = sf::Vector2f(currPair.rX, currPair.rY) * currentScale;
+                    sf::Vector2f pos = photoTransform.transformPoint(currPair.rX, currPair.rY);
                     sf::Vertex lines[] =
                     {
                         sf::Vertex(pos, sf::Color::Blue),
@@ -337,7 +497,7 @@ namespace facelapse {
                     window.draw(lines, 4, sf::Lines);
                 }
                 if (currPair.lX != -1) {
-                    sf::Vector2f pos = sf::Vector2f(currPair.lX, currPair.lY) * currentScale;
+                    sf::Vector2f pos = photoTransform.transformPoint(currPair.lX, currPair.lY);
                     sf::Vertex lines[] =
                     {
                         sf::Vertex(pos, sf::Color::Red),
@@ -350,16 +510,25 @@ namespace facelapse {
                 }
                 window.display();
                 needsRepaint = false;
+            } else if (!detector.idle()) {
+                sf::sleep(sf::milliseconds(10)); // waiting for detections
             }
         }
         return Canceled;
     }
 
+    // Frames added by the watch mode are appended here instead of rewriting the whole datafile
+    std::string journalFileName() {
+        return dataFileName + ".journal";
+    }
+
     void writeData(){
         if (dataFileName != "") {
             json jData;
             jData[jsonKeys::coordinates] = coordinatePairs;
             jData[jsonKeys::outputsettings] = outSettings; 
+            jData[jsonKeys::frameInfo] = frameInfos;
+            jData[jsonKeys::detector] = savedBackendName;
             jData[jsonKeys::version] = 2;
             
             std::ofstream file(dataFileName);
@@ -367,9 +536,142 @@ namespace facelapse {
                 file << jData;
             }
             file.close();
+            if (file.good()) {
+                std::remove(journalFileName().c_str()); // everything is in the datafile now
+            }
+        }
+    }
+
+    void journalFrame(std::string frameName) {
+        if (dataFileName != "") {
+            json entry;
+            entry[jsonKeys::journal::frame] = frameName;
+            entry[jsonKeys::journal::coordinates] = coordinatePairs[frameName];
+            entry[jsonKeys::journal::info] = frameInfos[frameName];
+
+            std::ofstream file(journalFileName(), std::ios::app);
+            file << entry << std::endl;
+        }
+    }
+
+    // Applies frames journaled since the datafile was last written
+    void replayJournal() {
+        std::ifstream file(journalFileName());
+        std::string line;
+        while (std::getline(file, line)) {
+            try {
+                json entry = json::parse(line);
+                std::string frameName = entry[jsonKeys::journal::frame];
+                coordinatePairs[frameName] = entry[jsonKeys::journal::coordinates];
+                frameInfos[frameName] = entry[jsonKeys::journal::info];
+            } catch (const std::exception&) {
+                break; // incomplete last line
+            }
         }
     }
 
+    std::string frameFileName(std::string outputFolder, int number) {
+        std::string nr = std::to_string(number);
+        return outputFolder + "frame" + std::string(5 - std::min<size_t>(5, nr.length()), '0') + nr + ".png";
+    }
+
+    volatile std::sig_atomic_t stopWatching = 0;
+
+    /*
+     * Watch mode: waits for new images in the folders, detects the eyes and renders them as the next frames
+     * of the output sequence. Runs until interrupted, frames that can't be detected are left for the editor.
+     */
+    int watchFolders(FolderWatcher& watcher, std::string outputFolder, int duplicateDistance) {
+        // Continue after the last rendered frame
+        int nextNumber = 0;
+        if (outputFolder != "") {
+            for (auto& f : listDirectory(outputFolder)) {
+                int nr;
+                if (std::sscanf(f.c_str() + outputFolder.length(), "frame%d.png", &nr) == 1) {
+                    nextNumber = std::max(nextNumber, nr + 1);
+                }
+            }
+        }
+
+        // Stop on Ctrl+C, without SA_RESTART so the blocking read is interrupted
+        struct sigaction action = {};
+        action.sa_handler = [](int) { stopWatching = 1; };
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        // Known frames, to skip duplicates
+        std::vector<std::string> known;
+        std::vector<long long> knownTimes;
+        HashIndex index;
+        for (auto& entry : frameInfos) {
+            if (entry.second.hasHash) {
+                index.insert(entry.second.hash, known.size());
+                known.push_back(entry.first);
+                knownTimes.push_back(captureSeconds(entry.second));
+            }
+        }
+
+        if (!initDetector()) {
+            return -1;
+        }
+        FrameRenderer renderer;
+        std::cout << "Watching for new frames, press Ctrl+C to stop." << std::endl;
+
+        std::string path;
+        while (!stopWatching && watcher.next(path)) {
+            auto start = std::chrono::steady_clock::now();
+            if (coordinatePairs.count(path) != 0) {
+                CoordinatePair known = coordinatePairs[path];
+                if (known.isComplete())
+                    continue; // already known
+            }
+
+            FrameInfo info;
+            readFrameInfo(path, info);
+            if (duplicateDistance >= 0) {
+                info.hasHash = perceptualHash(path, info.orientation, info.hash);
+                long long time = captureSeconds(info);
+                long near = info.hasHash ? index.findNear(info.hash, duplicateDistance, [&](long id) {
+                    return std::llabs(knownTimes[id] - time) <= DUPLICATESECONDS;
+                }) : -1;
+                if (near != -1 && known[near] != path) {
+                    std::cout << "Skipping " << path << ", duplicate of " << known[near] << std::endl;
+                    continue;
+                }
+            }
+            frameInfos[path] = info;
+            if (info.hasHash) {
+                index.insert(info.hash, known.size());
+                known.push_back(path);
+                knownTimes.push_back(captureSeconds(info));
+            }
+            CoordinatePair cp = findEyeCoords(path, info.orientation);
+            savedBackendName = detectorBackendName;
+            if (!cp.isComplete()) {
+                std::cout << "No eyes found in " << path << ", use the editor for it." << std::endl;
+                continue;
+            }
+            coordinatePairs[path] = cp;
+            journalFrame(path);
+
+            if (outputFolder != "") {
+                std::string fileName = frameFileName(outputFolder, nextNumber++);
+                renderer.render(path, frameTransform(path, outSettings), outSettings.width, outSettings.height, outSettings.bgColor);
+                std::unique_ptr<sf::Image> frameImage = renderer.flush();
+                if (!frameImage || !frameImage->saveToFile(fileName)) {
+                    std::cerr << path << " couldn't be saved as " << fileName << std::endl;
+                    continue;
+                }
+                path += " -> " + fileName;
+            }
+            float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << path << " ready in " << std::round(ms) << "ms" << std::endl;
+        }
+
+        writeData();
+        return 0;
+    }
+
     int fmain(int argc, char* argv[]) {
         if (argc <= 1) {
             std::cout << "No arguments provided. Use " << argv[0] << " -? for help" << std::endl;
@@ -381,6 +683,10 @@ namespace facelapse {
         bool forceAllFrames = false;
         bool autoDetect = false;
         std::string outputFolder;
+        std::vector<std::string> watchDirs;
+        int duplicateDistance = 4;
+        std::string backend;
+        std::vector<DetectionParams> evaluations;
 
         bool customColor = false;
         sf::Color backgroundColor;
@@ -404,6 +710,29 @@ namespace facelapse {
                         dataFileName = argv[++i];
                         hasDataFile = true;
                         break;
+                    case 'E': { // evaluate detector
+                        ASSERT(argc > i + 1, "-E needs one argument. Usage: -E <default|key=value,...>")
+                        DetectionParams params;
+                        ASSERT(parseDetectionParams(argv[++i], params), "invalid detector parameters " << argv[i] << ". Keys: height, scale, neighbors, eyescale, zoom, eyeheight, threshold")
+                        evaluations.push_back(params);
+                        break;
+                        }
+                    case 'w': // watch mode
+                        ASSERT(argc > i + 1, "-w needs one argument. Usage: -w <folder>")
+                        watchDirs.push_back(argv[++i]);
+                        break;
+                    case 'u': // duplicate distance
+                        ASSERT(argc > i + 1, "-u needs one argument. Usage: -u <max hash distance>")
+                        duplicateDistance = std::stoi(argv[++i]);
+                        break;
+                    case 'b': // detector backend
+                        ASSERT(argc > i + 1, "-b needs one argument. Usage: -b <haar|lbp>")
+                        backend = argv[++i];
+                        break;
+                    case 'm': // manifest
+                        ASSERT(argc > i + 1, "-m needs one argument. Usage: -m <manifest>")
+                        ASSERT(readManifest(argv[++i], frames), "couldn't read manifest " << argv[i])
+                        break;
                     case 'o': // outputfolder
                         ASSERT(argc > i + 1, "-o needs one argument. Usage: -o <outputfolder>")
                         outputFolder = argv[++i];
@@ -462,15 +791,23 @@ namespace facelapse {
                     default:
                         std::cerr << "unknown option -" << argv[i][1] << std::endl;
                     case '?': // help
-                        std::cout << "Usage: " << argv[0] << " [-d <file>] [-r <w> <h> | -R <720p=hd|1080p=fullhd>] [-c <r> <g> <b> <a> | -C <black|white|transparent>] [-e] [-a] [-x] [-o <folder>] frame0 frame1 ... frameN" << std::endl;
+                        std::cout << "Usage: " << argv[0] << " [-d <file>] [-r <w> <h> | -R <720p=hd|1080p=fullhd>] [-c <r> <g> <b> <a> | -C <black|white|transparent>] [-e] [-a] [-x] [-o <folder>] [-m <manifest>] [-E <default|key=value,...>] [-w <folder>] [-u <distance>] [-b <haar|lbp>] frame|folder ..." << std::endl;
                         std::cout << "Go to https://github.com/Indeximal/FaceLapse for further information" << std::endl;
                         return 0;
                 }
+            } else if (isDirectory(argv[i])) {
+                std::vector<std::string> content = listDirectory(argv[i]);
+                frames.insert(frames.end(), content.begin(), content.end());
             } else {
                 frames.push_back(std::string(argv[i]));
             }
         }
 
+        // Watch from the start, so pictures that arrive while the editor or the rendering runs aren't missed
+        FolderWatcher watcher;
+        for (auto& dir : watchDirs) {
+            ASSERT(watcher.add(dir), "couldn't watch " << dir)
+        }
         bool hadData = false;
         if (hasDataFile) {
             json jsonData;
@@ -484,6 +821,12 @@ namespace facelapse {
                 if (jsonData[jsonKeys::version] == 2) {
                     outSettings = jsonData[jsonKeys::outputsettings];
                     coordinatePairs = jsonData[jsonKeys::coordinates];
+                    if (jsonData.count(jsonKeys::frameInfo)) {
+                        frameInfos = jsonData[jsonKeys::frameInfo].get<std::map<std::string, FrameInfo>>();
+                    }
+                    if (jsonData.count(jsonKeys::detector)) {
+                        detectorBackendName = jsonData[jsonKeys::detector].get<std::string>();
+                    }
                 } else {
                     // Update older Settings to new format
                     outSettings.height = jsonData["display"]["height"];
@@ -502,8 +845,11 @@ namespace facelapse {
                 }
             }
             file.close();
+            replayJournal();
         }
 
+        savedBackendName = detectorBackendName;
+
         if (customColor) {
             outSettings.bgColor = backgroundColor;
         }
@@ -513,9 +859,102 @@ namespace facelapse {
             outSettings.height = outHeight;
         }
 
+        // Evaluate against all saved coordinates if no frames are given
+        if (!evaluations.empty() && frames.empty()) {
+            for (json::iterator it = coordinatePairs.begin(); it != coordinatePairs.end(); ++it) {
+                frames.push_back(it.key());
+            }
+        }
+
+        // Order frames by capture time, headers of new or changed files are scanned
+        std::sort(frames.begin(), frames.end());
+        frames.erase(std::unique(frames.begin(), frames.end()), frames.end());
+        scanFrameInfos(frames, frameInfos);
+        std::map<std::string, std::string> timeKeys;
+        for (auto& f : frames) {
+            timeKeys[f] = captureTimeKey(frameInfos[f]);
+        }
+        std::stable_sort(frames.begin(), frames.end(), [&timeKeys](const std::string& a, const std::string& b) {
+            return timeKeys[a] < timeKeys[b];
+        });
+
+        // Skip duplicates taken within seconds of each other, the first frame in capture order is kept
+        if (duplicateDistance >= 0 && evaluations.empty()) {
+            hashFrames(frames, frameInfos);
+            HashIndex index;
+            std::vector<std::string> unique;
+            std::vector<long long> uniqueTimes;
+            for (auto& f : frames) {
+                const FrameInfo& info = frameInfos[f];
+                long long time = captureSeconds(info);
+                if (info.hasHash) {
+                    long near = index.findNear(info.hash, duplicateDistance, [&](long id) {
+                        return std::llabs(uniqueTimes[id] - time) <= DUPLICATESECONDS;
+                    });
+                    if (near != -1) {
+                        std::cout << "Skipping " << f << ", duplicate of " << unique[near] << std::endl;
+                        continue;
+                    }
+                    index.insert(info.hash, unique.size());
+                }
+                unique.push_back(f);
+                uniqueTimes.push_back(time);
+            }
+            frames = unique;
+        }
+
         writeData();
 
+        // Keep detecting with the backend of the datafile, unless another one is chosen.
+        // The choice is only saved once frames are detected with it.
+        auto selectBackend = [&]() {
+            if (backend != "" && backend != detectorBackendName) {
+                if (hadData) {
+                    std::cout << "Switching detector backend from " << detectorBackendName << " to " << backend << std::endl;
+                }
+                detectorBackendName = backend;
+            }
+        };
+
+        // Once the given frames are done, or their phases were canceled, the watch mode takes over
+        auto finish = [&]() {
+            if (watchDirs.empty()) {
+                return 0;
+            }
+            selectBackend();
+            return watchFolders(watcher, outputFolder, duplicateDistance);
+        };
+
+        // Evaluation mode, the saved coordinates are the ground truth
+        if (!evaluations.empty()) {
+            if (backend != "") {
+                detectorBackendName = backend; // measured only, the datafile isn't written again
+            }
+            ASSERT(createBackend(detectorBackendName), "Detector backend " << detectorBackendName << " unavailable")
+            std::vector<std::string> evalFrames;
+            std::vector<CoordinatePair> truth;
+            std::vector<int> orientations;
+            for (auto& f : frames) {
+                if (coordinatePairs.count(f) == 0)
+                    continue;
+                CoordinatePair cp = coordinatePairs[f];
+                if (cp.isComplete()) {
+                    evalFrames.push_back(f);
+                    truth.push_back(cp);
+                    orientations.push_back(frameInfos[f].orientation);
+                }
+            }
+            std::cout << evalFrames.size() << " frames with saved coordinates" << std::endl;
+            for (auto& params : evaluations) {
+                evaluateDetector(evalFrames, truth, orientations, params);
+            }
+            return 0;
+        }
+
         if (frames.empty()) {
+            if (!watchDirs.empty()) {
+                return finish();
+            }
             std::cout << "No frames to process" << std::endl;
             return 0;
         }
@@ -526,20 +965,21 @@ namespace facelapse {
         // Eye indentification Phase
         std::vector<std::string> framesToDo = forceAllFrames ? frames : getUncompleteFrames(frames);
         if (framesToDo.size() > 0) {
+            selectBackend();
             ReturnStatus result = fillData(framesToDo, autoDetect);
             hideWindow();
             if (result == Saved){ // if successful (Enter)
                 writeData();
             } else { // canceled (ESC or close)
                 std::cout << "Canceled eye indentification phase." << std::endl;
-                return 0;
+                return finish();
             }
         }
 
         // Only continue if all data is availiable
         if (getUncompleteFrames(frames).size() != 0) {
             std::cout << "Uncomplete dataset." << std::endl;
-            return 0;
+            return finish();
         }
 
         // Positioning Phase
@@ -550,7 +990,7 @@ namespace facelapse {
                 writeData();
             } else { // canceled (ESC or close)
                 std::cout << "Canceled positioning phase." << std::endl;
-                return 0;
+                return finish();
             }
         }
 
@@ -562,33 +1002,46 @@ namespace facelapse {
             float secPerFrame = 0;
 
             std::thread saverThread([](){});
+            auto saveFrame = [&saverThread](std::unique_ptr<sf::Image> frameImage, std::string fileName) {
+                saverThread.join(); // wait for last frame to finish saving
+                saverThread = std::thread([](std::unique_ptr<sf::Image> img, std::string name){
+                    bool success = img->saveToFile(name); // save in saverThread
+                    if (!success)
+                        std::cerr << "frame couldn't be saved as " << name << std::endl; 
+                }, std::move(frameImage), fileName);
+            };
+
+            FrameRenderer renderer;
+            std::string pendingFileName;
             
             int framesProcessed = 0;
             for (int i = 0; i < frames.size(); i++) {
                 hideWindow();
 
                 std::cout << "\r[" << i+1 << "/" << frames.size() << "]" << std::flush;
-                std::string nr = std::to_string(i);
-                std::string fileName = outputFolder + "frame" + std::string(5 - nr.length(), '0') + nr + ".png";
+                std::string fileName = frameFileName(outputFolder, i);
 
-                sf::Image frameImage = transformFrameGL(frames[i]); // Transform ca 500ms
-
-                saverThread.join(); // wait for last frame to finish saving
-                saverThread = std::thread([=](){
-                    bool success = frameImage.saveToFile(fileName); // save in saverThread
-                    if (!success)
-                        std::cerr << frames[i] << " couldn't be saved as " << fileName << std::endl; 
-                });
+                sf::Transform transform = frameTransform(frames[i], outSettings);
+                std::unique_ptr<sf::Image> frameImage = renderer.render(frames[i], transform, outSettings.width, outSettings.height, outSettings.bgColor);
+                if (frameImage) { // the previous frame has been read back
+                    saveFrame(std::move(frameImage), pendingFileName);
+                }
+                pendingFileName = fileName;
 
                 framesProcessed++;
                 float timeLeft = clock.getElapsedTime().asSeconds() / framesProcessed * (frames.size() - i);
                 std::cout << " eta: " << std::round(timeLeft) << "s   " << std::flush;
             }
+            std::unique_ptr<sf::Image> lastImage = renderer.flush();
+            if (lastImage) {
+                saveFrame(std::move(lastImage), pendingFileName);
+            }
             saverThread.join();
 
             std::cout << "\r" << frames.size() << " frames processed in " << clock.getElapsedTime().asMilliseconds() << "ms" << std::endl;
         }
-        return 0;
+
+        return finish();
     } // main()
 } // namespace facelapse
 